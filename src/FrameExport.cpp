@@ -0,0 +1,519 @@
+#include <windows.h>
+#include <process.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wincodec.h>
+
+#include "KabLife.h"
+#include "FrameExport.h"
+
+FrameExporter::FrameExporter()
+{
+    memset(m_palette, 0, sizeof(m_palette));
+}
+
+FrameExporter::~FrameExporter()
+{
+    if (m_hEncoders)
+    {
+        Finish();
+    }
+    Release();
+}
+
+void FrameExporter::Release()
+{
+    free(m_frames);
+    free(m_frameCells);
+    free(m_freeRing);
+    free(m_readyRing);
+    free(m_hEncoders);
+
+    m_frames = NULL;
+    m_frameCells = NULL;
+    m_freeRing = NULL;
+    m_readyRing = NULL;
+    m_hEncoders = NULL;
+    m_encoderCount = 0;
+}
+
+HRESULT FrameExporter::Start(
+    const ExportOptions& options,
+    UINT gridWidth,
+    UINT gridHeight,
+    const UINT32* palette
+)
+{
+    HRESULT hr = S_OK;
+
+    if (options.scale == 0 || options.every == 0 || gridWidth == 0 || gridHeight == 0 ||
+        options.encoderThreads > EXPORT_MAX_ENCODERS || options.queueDepth > EXPORT_MAX_QUEUE_DEPTH)
+    {
+        return E_INVALIDARG;
+    }
+
+    // The encoders size their writes in 32 bits, so the whole three-plane
+    // frame has to fit in a UINT.
+    ULONGLONG frameWidth = (ULONGLONG)gridWidth * options.scale;
+    ULONGLONG frameHeight = (ULONGLONG)gridHeight * options.scale;
+    if (frameWidth > UINT_MAX || frameHeight > UINT_MAX || frameWidth * frameHeight * 3 > UINT_MAX)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_options = options;
+    m_gridWidth = gridWidth;
+    m_gridHeight = gridHeight;
+    m_frameWidth = static_cast<UINT>(frameWidth);
+    m_frameHeight = static_cast<UINT>(frameHeight);
+
+    // Precompute the colours in both output formats so the encoders only
+    // ever do table lookups. Y4M uses BT.601 limited range.
+    for (int i = 0; i < 256; i++)
+    {
+        int r = (palette[i] >> 16) & 0xFF;
+        int g = (palette[i] >> 8) & 0xFF;
+        int b = palette[i] & 0xFF;
+
+        m_palette[i] = palette[i];
+        m_paletteY[i] = static_cast<BYTE>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        m_paletteU[i] = static_cast<BYTE>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        m_paletteV[i] = static_cast<BYTE>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+
+    m_encoderCount = options.encoderThreads;
+    if (m_encoderCount == 0)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        m_encoderCount = si.dwNumberOfProcessors > 1 ? si.dwNumberOfProcessors - 1 : 1;
+        if (m_encoderCount > EXPORT_MAX_ENCODERS)
+        {
+            m_encoderCount = EXPORT_MAX_ENCODERS;
+        }
+    }
+
+    // With the counts capped, only the snapshot storage itself can outgrow
+    // a 32-bit size_t.
+    UINT depth = options.queueDepth ? options.queueDepth : m_encoderCount * 2;
+    UINT cellCount = gridWidth * gridHeight;
+    if ((ULONGLONG)depth * cellCount > SIZE_MAX)
+    {
+        m_encoderCount = 0;
+        return E_INVALIDARG;
+    }
+
+    m_frames = (ExportFrame*)(malloc(depth * sizeof(ExportFrame)));
+    m_frameCells = (BYTE*)(malloc((size_t)depth * cellCount));
+    m_freeRing = (UINT*)(malloc(depth * sizeof(UINT)));
+    m_readyRing = (UINT*)(malloc(depth * sizeof(UINT)));
+    m_hEncoders = (HANDLE*)(calloc(m_encoderCount, sizeof(HANDLE)));
+
+    if (!m_frames || !m_frameCells || !m_freeRing || !m_readyRing || !m_hEncoders)
+    {
+        Release();
+        return E_OUTOFMEMORY;
+    }
+
+    m_options.queueDepth = depth;
+    for (UINT i = 0; i < depth; i++)
+    {
+        m_frames[i].sequence = 0;
+        m_frames[i].cells = m_frameCells + (size_t)i * cellCount;
+        m_freeRing[i] = i;
+    }
+    m_freeHead = 0;
+    m_freeCount = depth;
+    m_readyHead = 0;
+    m_readyCount = 0;
+    m_nextSequence = 0;
+    m_nextWrite = 0;
+    m_framesWritten = 0;
+    m_closing = false;
+    m_hrError = S_OK;
+
+    if (options.format == ExportFormatY4m)
+    {
+        m_hOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+        hr = (m_hOutput != NULL && m_hOutput != INVALID_HANDLE_VALUE) ? S_OK : E_HANDLE;
+
+        if (SUCCEEDED(hr))
+        {
+            char header[96];
+            int length = sprintf_s(
+                header,
+                sizeof(header),
+                "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n",
+                m_frameWidth,
+                m_frameHeight,
+                options.fps
+            );
+            DWORD written;
+            hr = WriteFile(m_hOutput, header, length, &written, NULL) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+    else
+    {
+        if (!CreateDirectoryW(options.directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    for (UINT i = 0; SUCCEEDED(hr) && i < m_encoderCount; i++)
+    {
+        m_hEncoders[i] = (HANDLE)_beginthreadex(NULL, 0, FrameExporter::EncoderProc, this, 0, NULL);
+        if (!m_hEncoders[i])
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        Finish();
+    }
+
+    return hr;
+}
+
+ExportFrame* FrameExporter::AcquireFrame()
+{
+    ExportFrame* pFrame = NULL;
+
+    AcquireSRWLockExclusive(&m_lock);
+    while (m_freeCount == 0 && SUCCEEDED(m_hrError))
+    {
+        SleepConditionVariableSRW(&m_cvFree, &m_lock, INFINITE, 0);
+    }
+    if (SUCCEEDED(m_hrError))
+    {
+        pFrame = &m_frames[m_freeRing[m_freeHead]];
+        m_freeHead = (m_freeHead + 1) % m_options.queueDepth;
+        m_freeCount--;
+    }
+    ReleaseSRWLockExclusive(&m_lock);
+
+    return pFrame;
+}
+
+void FrameExporter::SubmitFrame(ExportFrame* pFrame)
+{
+    AcquireSRWLockExclusive(&m_lock);
+    pFrame->sequence = m_nextSequence++;
+    UINT tail = (m_readyHead + m_readyCount) % m_options.queueDepth;
+    m_readyRing[tail] = static_cast<UINT>(pFrame - m_frames);
+    m_readyCount++;
+    ReleaseSRWLockExclusive(&m_lock);
+
+    WakeConditionVariable(&m_cvReady);
+}
+
+HRESULT FrameExporter::Finish()
+{
+    AcquireSRWLockExclusive(&m_lock);
+    m_closing = true;
+    ReleaseSRWLockExclusive(&m_lock);
+    WakeAllConditionVariable(&m_cvReady);
+
+    for (UINT i = 0; i < m_encoderCount; i++)
+    {
+        if (m_hEncoders[i])
+        {
+            WaitForSingleObject(m_hEncoders[i], INFINITE);
+            CloseHandle(m_hEncoders[i]);
+            m_hEncoders[i] = NULL;
+        }
+    }
+
+    HRESULT hr = m_hrError;
+    Release();
+
+    return hr;
+}
+
+unsigned __stdcall FrameExporter::EncoderProc(void* ptr)
+{
+    FrameExporter* pExporter = reinterpret_cast<FrameExporter*>(ptr);
+
+    pExporter->RunEncoder();
+
+    return 0;
+}
+
+void FrameExporter::RunEncoder()
+{
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    bool comInitialized = SUCCEEDED(hr);
+
+    IWICImagingFactory* pFactory = NULL;
+    if (SUCCEEDED(hr) && m_options.format == ExportFormatPng)
+    {
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            NULL,
+            CLSCTX_INPROC_SERVER,
+            IID_PPV_ARGS(&pFactory)
+        );
+    }
+
+    // One output buffer per encoder, sized for three Y4M planes; PNG frames
+    // only use the first plane as palette indices.
+    BYTE* pixels = NULL;
+    if (SUCCEEDED(hr))
+    {
+        pixels = (BYTE*)(malloc((size_t)m_frameWidth * m_frameHeight * 3));
+        hr = pixels ? S_OK : E_OUTOFMEMORY;
+    }
+
+    for (;;)
+    {
+        AcquireSRWLockExclusive(&m_lock);
+        if (FAILED(hr) && SUCCEEDED(m_hrError))
+        {
+            m_hrError = hr;
+            WakeAllConditionVariable(&m_cvFree);
+            WakeAllConditionVariable(&m_cvWritten);
+        }
+        while (m_readyCount == 0 && !m_closing)
+        {
+            SleepConditionVariableSRW(&m_cvReady, &m_lock, INFINITE, 0);
+        }
+        if (m_readyCount == 0)
+        {
+            ReleaseSRWLockExclusive(&m_lock);
+            break;
+        }
+        UINT slot = m_readyRing[m_readyHead];
+        m_readyHead = (m_readyHead + 1) % m_options.queueDepth;
+        m_readyCount--;
+        bool failed = FAILED(m_hrError);
+        ReleaseSRWLockExclusive(&m_lock);
+
+        ExportFrame* pFrame = &m_frames[slot];
+        UINT sequence = pFrame->sequence;
+
+        // Rasterise straight out of the snapshot and give the slot back
+        // before encoding, so the stepper is only held up by rasterising.
+        if (!failed)
+        {
+            if (m_options.format == ExportFormatY4m)
+            {
+                RasterizeYuv(pFrame->cells, pixels);
+            }
+            else
+            {
+                RasterizeIndexed(pFrame->cells, pixels);
+            }
+        }
+
+        AcquireSRWLockExclusive(&m_lock);
+        m_freeRing[(m_freeHead + m_freeCount) % m_options.queueDepth] = slot;
+        m_freeCount++;
+        ReleaseSRWLockExclusive(&m_lock);
+        WakeConditionVariable(&m_cvFree);
+
+        if (!failed)
+        {
+            if (m_options.format == ExportFormatY4m)
+            {
+                hr = WriteY4m(sequence, pixels);
+            }
+            else
+            {
+                hr = WritePng(pFactory, sequence, pixels);
+            }
+
+            if (SUCCEEDED(hr))
+            {
+                AcquireSRWLockExclusive(&m_lock);
+                m_framesWritten++;
+                ReleaseSRWLockExclusive(&m_lock);
+            }
+        }
+    }
+
+    free(pixels);
+    SafeRelease(&pFactory);
+    if (comInitialized)
+    {
+        CoUninitialize();
+    }
+}
+
+void FrameExporter::RasterizeIndexed(const BYTE* cells, BYTE* pixels)
+{
+    UINT scale = m_options.scale;
+
+    for (UINT y = 0; y < m_gridHeight; y++)
+    {
+        const BYTE* row = cells + (size_t)y * m_gridWidth;
+        BYTE* out = pixels + (size_t)y * scale * m_frameWidth;
+
+        for (UINT x = 0; x < m_gridWidth; x++)
+        {
+            memset(out + x * scale, row[x], scale);
+        }
+        for (UINT i = 1; i < scale; i++)
+        {
+            memcpy(out + (size_t)i * m_frameWidth, out, m_frameWidth);
+        }
+    }
+}
+
+void FrameExporter::RasterizeYuv(const BYTE* cells, BYTE* pixels)
+{
+    const BYTE* planes[3] = { m_paletteY, m_paletteU, m_paletteV };
+    size_t planeSize = (size_t)m_frameWidth * m_frameHeight;
+    UINT scale = m_options.scale;
+
+    for (int p = 0; p < 3; p++)
+    {
+        const BYTE* lut = planes[p];
+        BYTE* plane = pixels + p * planeSize;
+
+        for (UINT y = 0; y < m_gridHeight; y++)
+        {
+            const BYTE* row = cells + (size_t)y * m_gridWidth;
+            BYTE* out = plane + (size_t)y * scale * m_frameWidth;
+
+            for (UINT x = 0; x < m_gridWidth; x++)
+            {
+                memset(out + x * scale, lut[row[x]], scale);
+            }
+            for (UINT i = 1; i < scale; i++)
+            {
+                memcpy(out + (size_t)i * m_frameWidth, out, m_frameWidth);
+            }
+        }
+    }
+}
+
+HRESULT FrameExporter::WritePng(IWICImagingFactory* pFactory, UINT sequence, const BYTE* pixels)
+{
+    HRESULT hr = S_OK;
+
+    IWICPalette* pPalette = NULL;
+    IWICStream* pStream = NULL;
+    IWICBitmapEncoder* pEncoder = NULL;
+    IWICBitmapFrameEncode* pFrameEncode = NULL;
+    IPropertyBag2* pProperties = NULL;
+
+    WCHAR path[MAX_PATH];
+    if (swprintf(path, MAX_PATH, L"%ls\\frame_%06u.png", m_options.directory, sequence) < 0)
+    {
+        hr = E_INVALIDARG;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pFactory->CreatePalette(&pPalette);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pPalette->InitializeCustom(m_palette, 256);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFactory->CreateStream(&pStream);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pStream->InitializeFromFilename(path, GENERIC_WRITE);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFactory->CreateEncoder(GUID_ContainerFormatPng, NULL, &pEncoder);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pEncoder->Initialize(pStream, WICBitmapEncoderNoCache);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pEncoder->CreateNewFrame(&pFrameEncode, &pProperties);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameEncode->Initialize(pProperties);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameEncode->SetSize(m_frameWidth, m_frameHeight);
+    }
+    if (SUCCEEDED(hr))
+    {
+        WICPixelFormatGUID format = GUID_WICPixelFormat8bppIndexed;
+        hr = pFrameEncode->SetPixelFormat(&format);
+        if (SUCCEEDED(hr) && !IsEqualGUID(format, GUID_WICPixelFormat8bppIndexed))
+        {
+            hr = WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+        }
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameEncode->SetPalette(pPalette);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameEncode->WritePixels(
+            m_frameHeight,
+            m_frameWidth,
+            m_frameWidth * m_frameHeight,
+            const_cast<BYTE*>(pixels)
+        );
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pFrameEncode->Commit();
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pEncoder->Commit();
+    }
+
+    SafeRelease(&pProperties);
+    SafeRelease(&pFrameEncode);
+    SafeRelease(&pEncoder);
+    SafeRelease(&pStream);
+    SafeRelease(&pPalette);
+
+    return hr;
+}
+
+HRESULT FrameExporter::WriteY4m(UINT sequence, const BYTE* pixels)
+{
+    HRESULT hr = S_OK;
+
+    // Encoders finish out of order; hold this frame until every earlier
+    // frame is on the stream.
+    AcquireSRWLockExclusive(&m_lock);
+    while (m_nextWrite != sequence && SUCCEEDED(m_hrError))
+    {
+        SleepConditionVariableSRW(&m_cvWritten, &m_lock, INFINITE, 0);
+    }
+    hr = m_hrError;
+    ReleaseSRWLockExclusive(&m_lock);
+
+    if (SUCCEEDED(hr))
+    {
+        static const char frameHeader[] = "FRAME\n";
+        DWORD written;
+        DWORD size = m_frameWidth * m_frameHeight * 3;
+
+        if (!WriteFile(m_hOutput, frameHeader, sizeof(frameHeader) - 1, &written, NULL) ||
+            !WriteFile(m_hOutput, pixels, size, &written, NULL))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    AcquireSRWLockExclusive(&m_lock);
+    m_nextWrite++;
+    ReleaseSRWLockExclusive(&m_lock);
+    WakeAllConditionVariable(&m_cvWritten);
+
+    return hr;
+}
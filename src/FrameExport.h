@@ -0,0 +1,144 @@
+#pragma once
+
+#include <windows.h>
+#include <wincodec.h>
+
+// Upper bounds on the encoder pool and the snapshot queue. Start rejects
+// anything larger, which also keeps every per-slot allocation well inside a
+// 32-bit size_t.
+#define EXPORT_MAX_ENCODERS 64
+#define EXPORT_MAX_QUEUE_DEPTH 256
+
+enum ExportFormat
+{
+    ExportFormatPng,
+    ExportFormatY4m
+};
+
+struct ExportOptions
+{
+    ExportFormat format = ExportFormatPng;
+
+    // Number of generations to simulate.
+    UINT generations = 1000;
+
+    // Export every Nth generation.
+    UINT every = 1;
+
+    // Edge length of a cell in output pixels.
+    UINT scale = 4;
+
+    // Encoder threads; 0 picks one less than the processor count, at most
+    // EXPORT_MAX_ENCODERS.
+    UINT encoderThreads = 0;
+
+    // Snapshot slots shared between the stepper and the encoders;
+    // 0 picks twice the encoder count. At most EXPORT_MAX_QUEUE_DEPTH.
+    UINT queueDepth = 0;
+
+    // Frame rate written to the Y4M stream header.
+    UINT fps = 30;
+
+    // Output directory for PNG sequences.
+    WCHAR directory[MAX_PATH] = L".";
+};
+
+// A snapshot of the board handed from the stepper to an encoder. Each cell
+// holds an index into the exporter's palette.
+struct ExportFrame
+{
+    UINT sequence;
+    BYTE* cells;
+};
+
+// Rasterises and encodes board snapshots on a pool of encoder threads.
+//
+// All buffers are allocated by Start. The stepper calls AcquireFrame, fills
+// in the cells and hands the frame back with SubmitFrame; AcquireFrame blocks
+// while every slot is waiting to be encoded, so a slow encoder throttles the
+// stepper instead of growing a backlog.
+class FrameExporter
+{
+public:
+    FrameExporter();
+    ~FrameExporter();
+
+    // Allocate the snapshot slots and start the encoder threads. The palette
+    // holds 256 colours as 0xAARRGGBB.
+    HRESULT Start(
+        const ExportOptions& options,
+        UINT gridWidth,
+        UINT gridHeight,
+        const UINT32* palette
+    );
+
+    // Wait for a free slot. Returns NULL once an encoder has failed.
+    ExportFrame* AcquireFrame();
+
+    // Queue a filled slot for encoding.
+    void SubmitFrame(ExportFrame* pFrame);
+
+    // Encode everything still queued, stop the encoder threads and return
+    // the first error any of them hit.
+    HRESULT Finish();
+
+    UINT FramesWritten() const { return m_framesWritten; }
+    UINT FrameWidth() const { return m_frameWidth; }
+    UINT FrameHeight() const { return m_frameHeight; }
+
+private:
+    static unsigned __stdcall EncoderProc(void* ptr);
+
+    void RunEncoder();
+
+    void RasterizeIndexed(const BYTE* cells, BYTE* pixels);
+
+    void RasterizeYuv(const BYTE* cells, BYTE* pixels);
+
+    HRESULT WritePng(IWICImagingFactory* pFactory, UINT sequence, const BYTE* pixels);
+
+    HRESULT WriteY4m(UINT sequence, const BYTE* pixels);
+
+    void Release();
+
+    ExportOptions m_options;
+
+    UINT m_gridWidth = 0;
+    UINT m_gridHeight = 0;
+    UINT m_frameWidth = 0;
+    UINT m_frameHeight = 0;
+
+    UINT32 m_palette[256];
+    BYTE m_paletteY[256];
+    BYTE m_paletteU[256];
+    BYTE m_paletteV[256];
+
+    // Snapshot slots and the two rings of slot indices that move them
+    // between the stepper and the encoders.
+    ExportFrame* m_frames = NULL;
+    BYTE* m_frameCells = NULL;
+    UINT* m_freeRing = NULL;
+    UINT* m_readyRing = NULL;
+    UINT m_freeHead = 0;
+    UINT m_freeCount = 0;
+    UINT m_readyHead = 0;
+    UINT m_readyCount = 0;
+    UINT m_nextSequence = 0;
+
+    // Next sequence number to go out on the Y4M stream.
+    UINT m_nextWrite = 0;
+    UINT m_framesWritten = 0;
+
+    bool m_closing = false;
+    HRESULT m_hrError = S_OK;
+
+    SRWLOCK m_lock = SRWLOCK_INIT;
+    CONDITION_VARIABLE m_cvFree = CONDITION_VARIABLE_INIT;
+    CONDITION_VARIABLE m_cvReady = CONDITION_VARIABLE_INIT;
+    CONDITION_VARIABLE m_cvWritten = CONDITION_VARIABLE_INIT;
+
+    HANDLE* m_hEncoders = NULL;
+    UINT m_encoderCount = 0;
+
+    HANDLE m_hOutput = INVALID_HANDLE_VALUE;
+};
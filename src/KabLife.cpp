@@ -1,11 +1,14 @@
 // Windows Header Files:
 #include <windows.h>
 #include <windowsx.h>
+#include <shellapi.h>
 
 // C RunTime Header Files:
 #include <stdlib.h>
 #include <malloc.h>
 #include <memory.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <wchar.h>
 #include <math.h>
 #include <time.h>
@@ -16,18 +19,11 @@
 #include <dwrite.h>
 #include <wincodec.h>
 
-template<class Interface>
-inline void SafeRelease(
-    Interface** ppInterfaceToRelease
-)
-{
-    if (*ppInterfaceToRelease != NULL)
-    {
-        (*ppInterfaceToRelease)->Release();
-
-        (*ppInterfaceToRelease) = NULL;
-    }
-}
+#include "KabLife.h"
+#include "FrameExport.h"
+#include "LifeGrid.h"
+#include "LifeRule.h"
+#include "Pacer.h"
 
 
 #ifndef Assert
@@ -45,11 +41,87 @@ EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 
 #define ID_BUTTON_START 0
 #define ID_BUTTON_PAUSE 1
+#define ID_BUTTON_AGES 2
+#define ID_COMBO_SPEED 3
+
+// Write a line of diagnostics to stderr. The GUI has no console, so this only
+// shows up when stderr is redirected.
+static void ReportStatus(const char* format, ...)
+{
+    HANDLE hError = GetStdHandle(STD_ERROR_HANDLE);
+    if (hError == NULL || hError == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    if (length > 0)
+    {
+        DWORD written;
+        WriteFile(hError, text, min(length, (int)sizeof(text) - 1), &written, NULL);
+    }
+}
+
+#define DEFAULT_GRID_WIDTH 180
+#define DEFAULT_GRID_HEIGHT 120
+
+// Largest board accepted from the command line. Keeps every per-cell buffer,
+// including the 32-bit pixel one, well inside a UINT.
+#define MAX_GRID_CELLS (1u << 24)
+
+// Generations per second offered in the speed box; 0 is as fast as
+// possible. The default is close to the old fixed 75 ms step.
+#define DEFAULT_TARGET_RATE 13
+static const UINT SpeedChoices[] = { 1, 5, 13, 30, 60, 250, 1000, 0 };
+
+// Microseconds on the performance counter, for the pacer.
+static LONGLONG NowMicroseconds()
+{
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+// Cell colours as 0xAARRGGBB.
+static const UINT32 CellColorDead = 0xFFFFFFFF;     // White
+static const UINT32 CellColorAlive = 0xFF6495ED;    // Cornflower blue
+static const UINT32 CellColorDying = 0xFF778899;    // Light slate gray
+
+static UINT32 BlendColor(UINT32 from, UINT32 to, UINT step, UINT steps)
+{
+    UINT32 result = 0xFF000000;
+
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        int a = (from >> shift) & 0xFF;
+        int b = (to >> shift) & 0xFF;
+        result |= static_cast<UINT32>(a + (b - a) * (int)step / (int)steps) << shift;
+    }
+
+    return result;
+}
+
+// Fill palette[first..last] with a fade from one colour to another.
+static void FillPaletteRange(UINT32* palette, UINT first, UINT last, UINT32 from, UINT32 to, UINT steps)
+{
+    for (UINT i = first; i <= last; i++)
+    {
+        palette[i] = BlendColor(from, to, min(i - first, steps), steps ? steps : 1);
+    }
+}
 
 class DemoApp
 {
 public:
-    DemoApp();
+    DemoApp(UINT gridWidth = DEFAULT_GRID_WIDTH, UINT gridHeight = DEFAULT_GRID_HEIGHT);
     ~DemoApp();
 
     // Register the window class and call methods for instantiating drawing resources
@@ -58,14 +130,47 @@ public:
     // Process and dispatch messages
     void RunMessageLoop();
 
+    // Run the simulation without a window, exporting frames as it goes
+    HRESULT RunExport(const ExportOptions& options);
+
+    // Turn the per-cell age channel on or off. Only call while the
+    // simulation thread is stopped.
+    bool SetTrackAges(bool trackAges);
+
+    // Switch to another rule. Only call while the simulation thread is
+    // stopped. Returns false, keeping the old rule, when out of memory.
+    bool SetRule(const LifeRule& rule);
+
+    // Generations per second for the GUI to aim for; 0 runs flat out.
+    void SetTargetRate(UINT generationsPerSecond);
+
 private:
-    UINT GridWidth = 180;
-    UINT GridHeight = 120;
+    UINT GridWidth;
+    UINT GridHeight;
 
-    BOOL* m_cell;
+    // The board, stepped as bit-planes.
+    LifeGrid m_grid;
 
-    BOOL* m_cell1;
-    BOOL* m_cell2;
+    // The board unpacked for drawing, one state per cell as defined by
+    // m_rule: 0 is dead, 1 is alive and anything higher is dying. m_cell
+    // points at m_cellStates once the board has been filled.
+    BYTE* m_cell = NULL;
+    BYTE* m_cellStates;
+
+    LifeRule m_rule;
+
+    // Generations each cell has been alive, saturating at 255. Updated by
+    // m_grid in its step pass and only allocated once ages are on.
+    bool m_trackAges = false;
+    BYTE* m_ages = NULL;
+
+    // Colours shared by the renderer and the exporter. Dead and dying
+    // cells map to a palette entry through m_stateIndex; with ages on, live
+    // cells use their age, capped at m_maxAgeIndex.
+    UINT32 m_palette[256];
+    BYTE m_stateIndex[LIFE_RULE_MAX_STATES];
+    BYTE m_maxAgeIndex = 1;
+    UINT32* m_cellPixels = NULL;
 
     UINT m_iterationCount = 0;
 
@@ -93,9 +198,28 @@ private:
 
     static void OnPauseButton(DemoApp* pDemoApp);
 
-    static void ProcessProc(void *ptr);
+    static unsigned __stdcall ProcessProc(void *ptr);
+
+    // Start the simulation thread, or signal it to stop and wait for it.
+    void StartSimulation();
+    void StopSimulation();
+
+    // Fill the current grid with a random pattern.
+    void Randomize();
+
+    // Advance the current grid by one generation.
+    void Step();
+
+    // The age plane, or NULL when ages are off.
+    BYTE* CurrentAges();
+
+    // Rebuild m_palette and m_stateIndex for the current rule and age mode.
+    void BuildPalette();
 
-    UINT CountNeighbors(UINT x, UINT y, BOOL *cell);
+    inline BYTE CellColorIndex(const BYTE* cells, const BYTE* ages, UINT index);
+
+    // Copy the current grid into an export frame as palette indices.
+    void SnapshotCells(BYTE* cells);
 
     inline UINT CellIndex(UINT x, UINT y);
 
@@ -109,17 +233,39 @@ private:
 
     bool m_ThreadRunning = false;
 
-    HANDLE m_hRunMutex;
+    // Set to ask the simulation thread to stop; it also wakes the thread
+    // from its pacing sleep.
+    HANDLE m_hStopEvent;
+    HANDLE m_hSimulationThread = NULL;
+
+    // Auto-reset; set when the target rate changes so the simulation thread
+    // wakes up and repaces straight away instead of finishing its sleep.
+    HANDLE m_hSettingsEvent;
+
+    // Only touched by the simulation thread.
+    Pacer m_pacer;
+
+    // Written by the GUI thread, picked up by the simulation thread on its
+    // next wake-up.
+    volatile UINT m_targetRate = DEFAULT_TARGET_RATE;
+
+    // Set while the window is minimised, so the simulation thread stops
+    // asking for redraws.
+    volatile bool m_renderSuspended = false;
+
     HWND m_hwndParent;
     HWND m_hwndRenderTarget;
     HWND m_hwndStartButton;
     HWND m_hwndPauseButton;
+    HWND m_hwndAgesButton;
+    HWND m_hwndSpeedCombo;
 
     // Direct2D objects
     ID2D1Factory* m_pDirect2dFactory;
     ID2D1HwndRenderTarget* m_pRenderTarget;
     ID2D1SolidColorBrush* m_pLightSlateGrayBrush;
     ID2D1SolidColorBrush* m_pCornflowerBlueBrush;
+    ID2D1Bitmap* m_pCellBitmap;
 
     // Text objects
     IDWriteFactory* m_pDWriteFactory;
@@ -127,28 +273,152 @@ private:
     ID2D1Factory* m_pD2DFactory;
 };
 
-DemoApp::DemoApp() :
+DemoApp::DemoApp(UINT gridWidth, UINT gridHeight) :
+    GridWidth(gridWidth),
+    GridHeight(gridHeight),
     m_hwndParent(NULL),
     m_pDirect2dFactory(NULL),
     m_pRenderTarget(NULL),
     m_pLightSlateGrayBrush(NULL),
-    m_pCornflowerBlueBrush(NULL)
+    m_pCornflowerBlueBrush(NULL),
+    m_pCellBitmap(NULL)
 {
-    m_cell1 = (BOOL*)(malloc(GridWidth * GridHeight * sizeof(BOOL)));
-    m_cell2 = (BOOL*)(malloc(GridWidth * GridHeight * sizeof(BOOL)));
+    m_cellStates = (BYTE*)(malloc(GridWidth * GridHeight));
+    m_cellPixels = (UINT32*)(malloc(GridWidth * GridHeight * sizeof(UINT32)));
 
-    m_cell = NULL;
+    // Initialize and RunExport report the failure.
+    if (!m_cellStates || !m_cellPixels || !m_grid.Allocate(GridWidth, GridHeight))
+    {
+        free(m_cellStates);
+        free(m_cellPixels);
+        m_cellStates = NULL;
+        m_cellPixels = NULL;
+    }
+
+    m_hStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    m_hSettingsEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+    ParseLifeRule(L"23/3", &m_rule);
+    BuildPalette();
 }
 
 DemoApp::~DemoApp()
 {
+    StopSimulation();
+    CloseHandle(m_hStopEvent);
+    CloseHandle(m_hSettingsEvent);
+
     SafeRelease(&m_pDirect2dFactory);
     SafeRelease(&m_pRenderTarget);
     SafeRelease(&m_pLightSlateGrayBrush);
     SafeRelease(&m_pCornflowerBlueBrush);
+    SafeRelease(&m_pCellBitmap);
+
+    free(m_cellStates);
+    free(m_ages);
+    free(m_cellPixels);
+}
+
+bool DemoApp::SetTrackAges(bool trackAges)
+{
+    if (trackAges && !m_ages)
+    {
+        m_ages = (BYTE*)(malloc(GridWidth * GridHeight));
+
+        if (!m_ages)
+        {
+            return false;
+        }
+    }
+
+    if (trackAges && !m_trackAges && m_cell)
+    {
+        // Nothing is known about the history of cells that are already
+        // alive, so they start out as newborn.
+        m_grid.Unpack(m_cell);
+        for (UINT i = 0; i < GridWidth * GridHeight; i++) {
+            m_ages[i] = (m_cell[i] == 1) ? 1 : 0;
+        }
+    }
+
+    m_trackAges = trackAges;
+    BuildPalette();
+
+    return true;
+}
+
+bool DemoApp::SetRule(const LifeRule& rule)
+{
+    // Cells in states the new rule does not have die.
+    if (!m_cellStates || !m_grid.SetRule(rule.survive, rule.birth, rule.states)) {
+        return false;
+    }
+
+    m_rule = rule;
+    BuildPalette();
 
-    free(m_cell1);
-    free(m_cell2);
+    return true;
+}
+
+void DemoApp::SetTargetRate(UINT generationsPerSecond)
+{
+    if (generationsPerSecond != m_targetRate) {
+        m_targetRate = generationsPerSecond;
+        SetEvent(m_hSettingsEvent);
+    }
+}
+
+void DemoApp::BuildPalette()
+{
+    UINT dyingStates = m_rule.states - 2;
+
+    memset(m_palette, 0, sizeof(m_palette));
+    m_palette[0] = CellColorDead;
+    m_stateIndex[0] = 0;
+
+    if (m_trackAges) {
+        // Newborn cells are green and survivors fade from cornflower blue to
+        // midnight blue over their first 64 generations. Dying states take
+        // the top of the palette.
+        m_maxAgeIndex = static_cast<BYTE>(255 - dyingStates);
+        m_palette[1] = 0xFF32CD32;      // Lime green
+        if (m_maxAgeIndex >= 2) {
+            FillPaletteRange(m_palette, 2, m_maxAgeIndex, CellColorAlive, 0xFF191970, 62);
+        }
+    }
+    else {
+        m_maxAgeIndex = 1;
+        m_palette[1] = CellColorAlive;
+    }
+    m_stateIndex[1] = 1;
+
+    if (dyingStates > 0) {
+        UINT first = m_maxAgeIndex + 1;
+        FillPaletteRange(m_palette, first, first + dyingStates - 1, CellColorDying, 0xFFDCDCDC, dyingStates);
+        for (UINT state = 2; state < m_rule.states; state++) {
+            m_stateIndex[state] = static_cast<BYTE>(first + state - 2);
+        }
+    }
+}
+
+BYTE DemoApp::CellColorIndex(const BYTE* cells, const BYTE* ages, UINT index)
+{
+    BYTE state = cells[index];
+
+    if (ages && state == 1) {
+        return min(ages[index], m_maxAgeIndex);
+    }
+
+    return m_stateIndex[state];
+}
+
+BYTE* DemoApp::CurrentAges()
+{
+    if (!m_trackAges) {
+        return NULL;
+    }
+
+    return m_ages;
 }
 
 UINT DemoApp::CellIndex(UINT x, UINT y) {
@@ -170,6 +440,11 @@ HRESULT DemoApp::Initialize()
 {
     HRESULT hr;
 
+    if (!m_cellStates)
+    {
+        return E_OUTOFMEMORY;
+    }
+
     // Initialize device-indpendent resources, such
     // as the Direct2D factory.
     hr = CreateDeviceIndependentResources();
@@ -240,6 +515,57 @@ HRESULT DemoApp::Initialize()
                 NULL
             );
 
+            m_hwndAgesButton = CreateWindow(
+                L"BUTTON",
+                L"Color by age",
+                WS_TABSTOP | WS_CHILD | WS_VISIBLE | BS_AUTOCHECKBOX,
+                (GridWidth * 10) - 290,
+                2,
+                110,
+                25,
+                m_hwndParent,
+                (HMENU)ID_BUTTON_AGES,
+                (HINSTANCE)GetWindowLongPtr(m_hwndParent, GWLP_HINSTANCE),
+                NULL
+            );
+            Button_SetCheck(m_hwndAgesButton, m_trackAges ? BST_CHECKED : BST_UNCHECKED);
+
+            m_hwndSpeedCombo = CreateWindow(
+                L"COMBOBOX",
+                NULL,
+                WS_TABSTOP | WS_CHILD | WS_VISIBLE | WS_VSCROLL | CBS_DROPDOWNLIST,
+                (GridWidth * 10) - 400,
+                2,
+                100,
+                200,
+                m_hwndParent,
+                (HMENU)ID_COMBO_SPEED,
+                (HINSTANCE)GetWindowLongPtr(m_hwndParent, GWLP_HINSTANCE),
+                NULL
+            );
+
+            // Offer the standard speeds, plus the one given on the command
+            // line if it is not among them.
+            bool custom = true;
+            for (UINT i = 0; i < _countof(SpeedChoices); i++) {
+                if (SpeedChoices[i] == m_targetRate) custom = false;
+            }
+
+            UINT choices = _countof(SpeedChoices) + (custom ? 1 : 0);
+            for (UINT i = 0; i < choices; i++) {
+                UINT rate = (i < _countof(SpeedChoices)) ? SpeedChoices[i] : m_targetRate;
+
+                wchar_t wszSpeed[32];
+                if (rate) swprintf(wszSpeed, 32, L"%u gen/s", rate);
+                else wcscpy_s(wszSpeed, 32, L"Max speed");
+
+                int index = ComboBox_AddString(m_hwndSpeedCombo, wszSpeed);
+                ComboBox_SetItemData(m_hwndSpeedCombo, index, rate);
+                if (rate == m_targetRate) {
+                    ComboBox_SetCurSel(m_hwndSpeedCombo, index);
+                }
+            }
+
             wcex.lpszClassName = L"RenderTarget";
             RegisterClassEx(&wcex);
             m_hwndRenderTarget = CreateWindow(
@@ -347,6 +673,18 @@ HRESULT DemoApp::CreateDeviceResources()
                 &m_pCornflowerBlueBrush
             );
         }
+        if (SUCCEEDED(hr))
+        {
+            // Create the bitmap that palette colours are uploaded into, one
+            // pixel per cell.
+            hr = m_pRenderTarget->CreateBitmap(
+                D2D1::SizeU(GridWidth, GridHeight),
+                D2D1::BitmapProperties(
+                    D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE)
+                ),
+                &m_pCellBitmap
+            );
+        }
     }
 
     return hr;
@@ -357,6 +695,7 @@ void DemoApp::DiscardDeviceResources()
     SafeRelease(&m_pRenderTarget);
     SafeRelease(&m_pLightSlateGrayBrush);
     SafeRelease(&m_pCornflowerBlueBrush);
+    SafeRelease(&m_pCellBitmap);
 }
 
 void DemoApp::OnResize(UINT width, UINT height)
@@ -370,89 +709,113 @@ void DemoApp::OnResize(UINT width, UINT height)
     }
 }
 
-UINT DemoApp::CountNeighbors(UINT x, UINT y, BOOL *cell) {
-    UINT result = 0;
+void DemoApp::Randomize()
+{
+    m_cell = m_cellStates;
+
+    m_iterationCount = 0;
 
-    if (y > 0) {
-        if (x > 0 && cell[CellIndex(x - 1, y - 1)]) result++;
-        if (cell[((y - 1) * GridWidth) + x]) result++;
-        if (x + 1 < GridWidth && cell[((y - 1) * GridWidth) + x + 1]) result++;
+    for (UINT x = 0; x < GridWidth; x++) {
+        for (UINT y = 0; y < GridHeight; y++) {
+            if (rand() % 100 > 50) m_cell[CellIndex(x, y)] = 1;
+            else m_cell[CellIndex(x, y)] = 0;
+        }
     }
 
-    if (x > 0 && cell[(y * GridWidth) + x - 1]) result++;
-    if (x + 1 < GridWidth && cell[(y * GridWidth) + x + 1]) result++;
+    m_grid.Pack(m_cell);
 
-    if (y + 1 < GridHeight) {
-        if (x > 0 && cell[((y + 1) * GridWidth) + x - 1]) result++;
-        if (y > 0 && cell[((y + 1) * GridWidth) + x]) result++;
-        if (x + 1 < GridWidth && cell[((y + 1) * GridWidth) + x + 1]) result++;
+    if (m_trackAges) {
+        for (UINT i = 0; i < GridWidth * GridHeight; i++) {
+            m_ages[i] = m_cell[i];
+        }
     }
-    return result;
 }
 
-void DemoApp::ProcessProc(void *ptr)
+void DemoApp::Step()
 {
-    DemoApp* pDemoApp = reinterpret_cast<DemoApp*>(ptr);
+    m_iterationCount++;
+    m_grid.Step(m_trackAges ? m_ages : NULL);
+}
+
+void DemoApp::SnapshotCells(BYTE* cells)
+{
+    UINT count = GridWidth * GridHeight;
+    BYTE* ages = CurrentAges();
+
+    m_grid.Unpack(cells);
+    for (UINT i = 0; i < count; i++) {
+        cells[i] = CellColorIndex(cells, ages, i);
+    }
+}
 
-    pDemoApp->m_ThreadRunning = true;
+unsigned __stdcall DemoApp::ProcessProc(void *ptr)
+{
+    DemoApp* pDemoApp = reinterpret_cast<DemoApp*>(ptr);
+    Pacer& pacer = pDemoApp->m_pacer;
 
-    BOOL* oldGrid = pDemoApp->m_cell;
-    BOOL* newGrid = (oldGrid == pDemoApp->m_cell ? pDemoApp->m_cell2 : pDemoApp->m_cell1 );
-    BOOL* tempGrid;
+    pacer.SetTarget(pDemoApp->m_targetRate);
+    pacer.Start(NowMicroseconds());
 
-    UINT neighbors;
+    // The stop event comes first so it wins when both are signalled.
+    HANDLE events[] = { pDemoApp->m_hStopEvent, pDemoApp->m_hSettingsEvent };
+    DWORD wait = 0;
 
-    do {
-        pDemoApp->m_iterationCount++; 
-        if (pDemoApp->m_cell == &pDemoApp->m_cell1[0]) {
-            oldGrid = &pDemoApp->m_cell1[0];
-            newGrid = &pDemoApp->m_cell2[0];
+    for (;;) {
+        DWORD signalled = WaitForMultipleObjects(_countof(events), events, FALSE, wait);
+        if (signalled != WAIT_TIMEOUT && signalled != WAIT_OBJECT_0 + 1) {
+            break;
         }
-        else {
-            oldGrid = &pDemoApp->m_cell2[0];
-            newGrid = &pDemoApp->m_cell1[0];
+
+        UINT targetRate = pDemoApp->m_targetRate;
+        if (targetRate != pacer.Target()) {
+            pacer.SetTarget(targetRate);
+            pacer.Start(NowMicroseconds());
         }
 
-        for (int x = 0; x < pDemoApp->GridWidth; x++) {
-            for (int y = 0; y < pDemoApp->GridHeight; y++) {
-                neighbors = pDemoApp->CountNeighbors(x, y, oldGrid);
-                BOOL alive = oldGrid[(y * pDemoApp->GridWidth) + x];
+        UINT batch = pacer.BatchSize();
 
-                if ((alive && (neighbors == 2 || neighbors == 3)) || (!alive && neighbors == 3)) {
-                    newGrid[(y * pDemoApp->GridWidth) + x] = TRUE;
-                }
-                else {
-                    newGrid[(y * pDemoApp->GridWidth) + x] = FALSE;
-                }
-            }
+        LONGLONG started = NowMicroseconds();
+        for (UINT i = 0; i < batch; i++) {
+            pDemoApp->Step();
         }
+        LONGLONG finished = NowMicroseconds();
 
-        pDemoApp->m_cell = newGrid;
-        tempGrid = oldGrid;
-        oldGrid = newGrid;
-        newGrid = tempGrid;
+        if (!pDemoApp->m_renderSuspended) {
+            InvalidateRect(pDemoApp->m_hwndParent, NULL, FALSE);
+        }
 
-        InvalidateRect(pDemoApp->m_hwndParent, NULL, FALSE);
+        // Round up to whole milliseconds; the pacer makes up for the
+        // difference on the next wake-up.
+        wait = static_cast<DWORD>((pacer.OnBatchComplete(batch, finished - started, finished) + 999) / 1000);
     }
-    while (WaitForSingleObject(pDemoApp->m_hRunMutex, 75L) == WAIT_TIMEOUT);
-    pDemoApp->m_ThreadRunning = false;
-}
 
-void DemoApp::OnStartButton(DemoApp *pDemoApp) {
-    pDemoApp->m_cell = pDemoApp->m_cell1;
+    return 0;
+}
 
-    pDemoApp->m_hRunMutex = CreateMutexW(NULL, TRUE, NULL);
+void DemoApp::StartSimulation()
+{
+    ResetEvent(m_hStopEvent);
 
-    pDemoApp->m_iterationCount = 0;
+    m_hSimulationThread = (HANDLE)_beginthreadex(NULL, 0, DemoApp::ProcessProc, this, 0, NULL);
+    m_ThreadRunning = (m_hSimulationThread != NULL);
+}
 
-    for (int x = 0; x < pDemoApp->GridWidth; x++) {
-        for (int y = 0; y < pDemoApp->GridHeight; y++) {
-            if (rand() % 100 > 50) pDemoApp->m_cell[pDemoApp->CellIndex(x, y)] = TRUE;
-            else pDemoApp->m_cell[pDemoApp->CellIndex(x, y)] = FALSE;
-        }
+void DemoApp::StopSimulation()
+{
+    if (m_hSimulationThread) {
+        SetEvent(m_hStopEvent);
+        WaitForSingleObject(m_hSimulationThread, INFINITE);
+        CloseHandle(m_hSimulationThread);
+        m_hSimulationThread = NULL;
     }
 
-    _beginthread(DemoApp::ProcessProc, 0, pDemoApp);
+    m_ThreadRunning = false;
+}
+
+void DemoApp::OnStartButton(DemoApp *pDemoApp) {
+    pDemoApp->Randomize();
+
+    pDemoApp->StartSimulation();
 }
 
 void DemoApp::OnPauseButton(DemoApp* pDemoApp) {
@@ -460,19 +823,102 @@ void DemoApp::OnPauseButton(DemoApp* pDemoApp) {
     {
         Button_Enable(pDemoApp->m_hwndStartButton, TRUE);
         Button_Enable(pDemoApp->m_hwndPauseButton, TRUE);
+        Button_Enable(pDemoApp->m_hwndAgesButton, TRUE);
         SendMessage(pDemoApp->m_hwndPauseButton, WM_SETTEXT, 0, (LPARAM)L"Resume");
-        ReleaseMutex(pDemoApp->m_hRunMutex);
+        pDemoApp->StopSimulation();
     }
     else
     {
         Button_Enable(pDemoApp->m_hwndStartButton, FALSE);
         Button_Enable(pDemoApp->m_hwndPauseButton, TRUE);
+        Button_Enable(pDemoApp->m_hwndAgesButton, FALSE);
         SendMessage(pDemoApp->m_hwndPauseButton, WM_SETTEXT, 0, (LPARAM)L"Pause");
 
-        pDemoApp->m_hRunMutex = CreateMutexW(NULL, TRUE, NULL);
+        pDemoApp->StartSimulation();
+    }
+}
+
+HRESULT DemoApp::RunExport(const ExportOptions& options)
+{
+    HRESULT hr = S_OK;
 
-        _beginthread(DemoApp::ProcessProc, 0, pDemoApp);
+    if (!m_cellStates)
+    {
+        ReportStatus("Not enough memory for a %ux%u board\n", GridWidth, GridHeight);
+        return E_OUTOFMEMORY;
     }
+
+    FrameExporter exporter;
+
+    LARGE_INTEGER frequency, started, finished, stallStarted, stallFinished, stepStarted, stepFinished;
+    LONGLONG stalled = 0;
+    LONGLONG stepping = 0;
+    UINT generations = 0;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&started);
+
+    hr = exporter.Start(options, GridWidth, GridHeight, m_palette);
+    if (SUCCEEDED(hr))
+    {
+        Randomize();
+
+        for (UINT generation = 0; generation < options.generations; generation++)
+        {
+            if (generation % options.every == 0)
+            {
+                QueryPerformanceCounter(&stallStarted);
+                ExportFrame* pFrame = exporter.AcquireFrame();
+                QueryPerformanceCounter(&stallFinished);
+                stalled += stallFinished.QuadPart - stallStarted.QuadPart;
+
+                if (!pFrame)
+                {
+                    break;
+                }
+
+                SnapshotCells(pFrame->cells);
+                exporter.SubmitFrame(pFrame);
+            }
+
+            QueryPerformanceCounter(&stepStarted);
+            Step();
+            QueryPerformanceCounter(&stepFinished);
+            stepping += stepFinished.QuadPart - stepStarted.QuadPart;
+            generations++;
+        }
+
+        hr = exporter.Finish();
+    }
+
+    QueryPerformanceCounter(&finished);
+    double seconds = (double)(finished.QuadPart - started.QuadPart) / frequency.QuadPart;
+
+    ReportStatus(
+        "%u frames of %ux%u in %.2f s (%.1f frames/s, stepper waited %.2f s)\n",
+        exporter.FramesWritten(),
+        exporter.FrameWidth(),
+        exporter.FrameHeight(),
+        seconds,
+        seconds > 0 ? exporter.FramesWritten() / seconds : 0.0,
+        (double)stalled / frequency.QuadPart
+    );
+    char ruleText[32];
+    FormatLifeRule(&m_rule, ruleText, sizeof(ruleText));
+    ReportStatus(
+        "%u generations of %ux%u cells under rule %s in %.2f s of stepping (%.1f generations/s)\n",
+        generations,
+        GridWidth,
+        GridHeight,
+        ruleText,
+        (double)stepping / frequency.QuadPart,
+        stepping > 0 ? generations / ((double)stepping / frequency.QuadPart) : 0.0
+    );
+    if (FAILED(hr))
+    {
+        ReportStatus("Export failed: 0x%08lX\n", hr);
+    }
+
+    return hr;
 }
 
 HRESULT DemoApp::OnRender()
@@ -480,13 +926,30 @@ HRESULT DemoApp::OnRender()
     HRESULT hr = S_OK;
 
     hr = CreateDeviceResources();
+
+    // Nothing on screen would change, so skip drawing while the window is
+    // minimised or covered.
+    if (SUCCEEDED(hr) &&
+        (m_renderSuspended || (m_pRenderTarget->CheckWindowState() & D2D1_WINDOW_STATE_OCCLUDED)))
+    {
+        return hr;
+    }
+
     if (SUCCEEDED(hr))
     {
         wchar_t wszText[20];
         swprintf(wszText, 20, L"Iteration: %d", m_iterationCount);
         UINT32 cTextLength_ = (UINT32)wcslen(wszText);
 
-        BOOL* cell = m_cell;
+        BYTE* cell = m_cell;
+        BYTE* ages = CurrentAges();
+        if (cell) {
+            m_grid.Unpack(cell);
+        }
+
+        // Cells only need colours beyond plain alive when ages are on or the
+        // rule has dying states.
+        bool usePalette = (ages != NULL || m_rule.states > 2);
 
         m_pRenderTarget->BeginDraw();
 
@@ -497,7 +960,25 @@ HRESULT DemoApp::OnRender()
         int width = GridWidth * 10 + 2;
         int height = GridHeight * 10 + 2;
 
-        // Draw grid first
+        if (cell && usePalette) {
+            // Colour cells through the palette and stretch the result over
+            // the grid, letting the grid lines draw on top.
+            UINT count = GridWidth * GridHeight;
+            for (UINT i = 0; i < count; i++) {
+                m_cellPixels[i] = m_palette[CellColorIndex(cell, ages, i)];
+            }
+
+            m_pCellBitmap->CopyFromMemory(NULL, m_cellPixels, GridWidth * sizeof(UINT32));
+
+            m_pRenderTarget->DrawBitmap(
+                m_pCellBitmap,
+                D2D1::RectF(1.0f, 1.0f, static_cast<FLOAT>(width - 1), static_cast<FLOAT>(height - 1)),
+                1.0f,
+                D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR
+            );
+        }
+
+        // Draw grid lines
         for (int x = 0; x <= GridWidth; x++) {
             m_pRenderTarget->DrawLine(
                 D2D1::Point2F(static_cast<FLOAT>((x * 10) + 1), 0),
@@ -516,18 +997,20 @@ HRESULT DemoApp::OnRender()
             );
         }
 
-        if (m_cell) {
-            // Then draw cells
-            for (int x = 0; x < GridWidth; x++) {
-                for (int y = 0; y < GridHeight; y++) {
-                    if (cell[CellIndex(x, y)]) {
-                        D2D1_RECT_F rectangle1 = D2D1::RectF(
-                            (x * 10) + 2,
-                            (y * 10) + 2,
-                            (x * 10) + 10,
-                            (y * 10) + 10
-                        );
-                        m_pRenderTarget->FillRectangle(&rectangle1, m_pCornflowerBlueBrush);
+        if (cell) {
+            // Then draw cells, unless the palette bitmap already covers them
+            if (!usePalette) {
+                for (UINT x = 0; x < GridWidth; x++) {
+                    for (UINT y = 0; y < GridHeight; y++) {
+                        if (cell[CellIndex(x, y)] == 1) {
+                            D2D1_RECT_F rectangle1 = D2D1::RectF(
+                                (x * 10) + 2,
+                                (y * 10) + 2,
+                                (x * 10) + 10,
+                                (y * 10) + 10
+                            );
+                            m_pRenderTarget->FillRectangle(&rectangle1, m_pCornflowerBlueBrush);
+                        }
                     }
                 }
             }
@@ -563,10 +1046,11 @@ HRESULT DemoApp::OnRender()
 bool DemoApp::HandleControlMessage(DemoApp* pDemoApp, HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam) {
     bool result = false;
 
-    switch (wParam) {
+    switch (LOWORD(wParam)) {
     case ID_BUTTON_START:
         Button_Enable(pDemoApp->m_hwndStartButton, FALSE);
         Button_Enable(pDemoApp->m_hwndPauseButton, TRUE);
+        Button_Enable(pDemoApp->m_hwndAgesButton, FALSE);
         SendMessage(pDemoApp->m_hwndPauseButton, WM_SETTEXT, 0, (LPARAM)L"Pause");
         DemoApp::OnStartButton(pDemoApp);
         result = true;
@@ -575,6 +1059,22 @@ bool DemoApp::HandleControlMessage(DemoApp* pDemoApp, HWND hwnd, UINT message, W
         DemoApp::OnPauseButton(pDemoApp);
         result = true;
         break;
+    case ID_BUTTON_AGES:
+        if (!pDemoApp->SetTrackAges(Button_GetCheck(pDemoApp->m_hwndAgesButton) == BST_CHECKED)) {
+            Button_SetCheck(pDemoApp->m_hwndAgesButton, BST_UNCHECKED);
+        }
+        InvalidateRect(pDemoApp->m_hwndParent, NULL, FALSE);
+        result = true;
+        break;
+    case ID_COMBO_SPEED:
+        if (HIWORD(wParam) == CBN_SELCHANGE) {
+            int index = ComboBox_GetCurSel(pDemoApp->m_hwndSpeedCombo);
+            if (index != CB_ERR) {
+                pDemoApp->SetTargetRate(static_cast<UINT>(ComboBox_GetItemData(pDemoApp->m_hwndSpeedCombo, index)));
+            }
+            result = true;
+        }
+        break;
     }
 
     return result;
@@ -617,9 +1117,19 @@ LRESULT CALLBACK DemoApp::WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
                 break;
             case WM_SIZE:
             {
-                UINT width = LOWORD(lParam);
-                UINT height = HIWORD(lParam);
-                pDemoApp->OnResize(width, height);
+                if (wParam == SIZE_MINIMIZED)
+                {
+                    pDemoApp->m_renderSuspended = true;
+                }
+                else
+                {
+                    UINT width = LOWORD(lParam);
+                    UINT height = HIWORD(lParam);
+                    pDemoApp->OnResize(width, height);
+
+                    pDemoApp->m_renderSuspended = false;
+                    InvalidateRect(hwnd, NULL, FALSE);
+                }
             }
             result = 0;
             wasHandled = true;
@@ -644,8 +1154,8 @@ LRESULT CALLBACK DemoApp::WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
 
             case WM_DESTROY:
             {
+                pDemoApp->StopSimulation();
                 PostQuitMessage(0);
-                ReleaseMutex(pDemoApp->m_hRunMutex);
             }
             result = 1;
             wasHandled = true;
@@ -662,6 +1172,79 @@ LRESULT CALLBACK DemoApp::WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM
     return result;
 }
 
+// Parse "/name:value" switches. Returns S_OK when a headless export was
+// requested, S_FALSE to run the GUI and E_INVALIDARG on a bad switch.
+static HRESULT ParseCommandLine(
+    int argc,
+    LPWSTR* argv,
+    ExportOptions* pOptions,
+    UINT* pGridWidth,
+    UINT* pGridHeight,
+    UINT* pSeed,
+    bool* pTrackAges,
+    LifeRule* pRule,
+    UINT* pTargetRate
+)
+{
+    HRESULT hr = S_FALSE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        LPWSTR name = argv[i];
+        if (name[0] != L'/' && name[0] != L'-')
+        {
+            return E_INVALIDARG;
+        }
+        name++;
+
+        LPWSTR value = wcschr(name, L':');
+        if (value)
+        {
+            *value++ = L'\0';
+        }
+        else
+        {
+            value = name + wcslen(name);
+        }
+        UINT number = wcstoul(value, NULL, 10);
+
+        if (_wcsicmp(name, L"export") == 0)
+        {
+            if (_wcsicmp(value, L"png") == 0) pOptions->format = ExportFormatPng;
+            else if (_wcsicmp(value, L"y4m") == 0) pOptions->format = ExportFormatY4m;
+            else return E_INVALIDARG;
+            hr = S_OK;
+        }
+        else if (_wcsicmp(name, L"out") == 0)
+        {
+            if (wcscpy_s(pOptions->directory, MAX_PATH, value) != 0) return E_INVALIDARG;
+        }
+        else if (_wcsicmp(name, L"generations") == 0) pOptions->generations = number;
+        else if (_wcsicmp(name, L"every") == 0 && number > 0) pOptions->every = number;
+        else if (_wcsicmp(name, L"scale") == 0 && number > 0) pOptions->scale = number;
+        else if (_wcsicmp(name, L"encoders") == 0 && number <= EXPORT_MAX_ENCODERS) pOptions->encoderThreads = number;
+        else if (_wcsicmp(name, L"queue") == 0 && number <= EXPORT_MAX_QUEUE_DEPTH) pOptions->queueDepth = number;
+        else if (_wcsicmp(name, L"fps") == 0 && number > 0) pOptions->fps = number;
+        else if (_wcsicmp(name, L"width") == 0 && number > 0) *pGridWidth = number;
+        else if (_wcsicmp(name, L"height") == 0 && number > 0) *pGridHeight = number;
+        else if (_wcsicmp(name, L"seed") == 0) *pSeed = number;
+        else if (_wcsicmp(name, L"ages") == 0) *pTrackAges = true;
+        else if (_wcsicmp(name, L"speed") == 0) *pTargetRate = number;
+        else if (_wcsicmp(name, L"rule") == 0)
+        {
+            if (FAILED(ParseLifeRule(value, pRule))) return E_INVALIDARG;
+        }
+        else return E_INVALIDARG;
+    }
+
+    if ((ULONGLONG)*pGridWidth * *pGridHeight > MAX_GRID_CELLS)
+    {
+        return E_INVALIDARG;
+    }
+
+    return hr;
+}
+
 int WINAPI WinMain(
     HINSTANCE /* hInstance */,
     HINSTANCE /* hPrevInstance */,
@@ -669,7 +1252,32 @@ int WINAPI WinMain(
     int /* nCmdShow */
 )
 {
-    srand(time(NULL));
+    ExportOptions exportOptions;
+    UINT gridWidth = DEFAULT_GRID_WIDTH;
+    UINT gridHeight = DEFAULT_GRID_HEIGHT;
+    UINT seed = (UINT)time(NULL);
+    bool trackAges = false;
+    LifeRule rule;
+    ParseLifeRule(L"23/3", &rule);
+    UINT targetRate = DEFAULT_TARGET_RATE;
+
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    HRESULT hrArgs = argv ? ParseCommandLine(argc, argv, &exportOptions, &gridWidth, &gridHeight, &seed, &trackAges, &rule, &targetRate) : S_FALSE;
+    LocalFree(argv);
+
+    if (FAILED(hrArgs))
+    {
+        ReportStatus(
+            "Usage: KabLife [/width:cells] [/height:cells] [/seed:n] [/ages] [/rule:S/B/C]\n"
+            "               [/speed:generations per second, 0 for max]\n"
+            "               [/export:png|y4m [/out:dir] [/generations:n] [/every:n]\n"
+            "                [/scale:pixels] [/encoders:n] [/queue:n] [/fps:n]]\n"
+        );
+        return 1;
+    }
+
+    srand(seed);
     
     // Use HeapSetInformation to specify that the process should
     // terminate if the heap manager detects an error in any heap used
@@ -678,12 +1286,26 @@ int WINAPI WinMain(
     // unlikely event that HeapSetInformation fails.
     HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
+    int exitCode = 0;
+
     if (SUCCEEDED(CoInitialize(NULL)))
     {
         {
-            DemoApp app;
+            DemoApp app(gridWidth, gridHeight);
+            bool ruleSet = app.SetRule(rule);
+            app.SetTrackAges(trackAges);
+            app.SetTargetRate(targetRate);
 
-            if (SUCCEEDED(app.Initialize()))
+            if (!ruleSet)
+            {
+                ReportStatus("Not enough memory for a %ux%u board\n", gridWidth, gridHeight);
+                exitCode = 1;
+            }
+            else if (hrArgs == S_OK)
+            {
+                exitCode = SUCCEEDED(app.RunExport(exportOptions)) ? 0 : 1;
+            }
+            else if (SUCCEEDED(app.Initialize()))
             {
                 app.RunMessageLoop();
             }
@@ -691,5 +1313,5 @@ int WINAPI WinMain(
         CoUninitialize();
     }
 
-    return 0;
+    return exitCode;
 }
\ No newline at end of file
@@ -0,0 +1,359 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LifeGrid.h"
+
+// Enough counter planes for the 254 dying states of a 256-state rule.
+static const unsigned int MaxCounterPlanes = 8;
+
+// Bits in the live neighbour count at each cell of a word, from the
+// bit-sliced sum of its eight neighbour words.
+struct NeighborCount
+{
+    unsigned long long bit0, bit1, bit2, bit3;
+};
+
+// Mask of the cells whose neighbour count is one of those set in `counts`.
+static inline unsigned long long CountIn(unsigned int counts, const NeighborCount& n)
+{
+    unsigned long long result = 0;
+
+    for (unsigned int count = 0; count < 9; count++)
+    {
+        if ((counts >> count) & 1)
+        {
+            result |= ((count & 1) ? n.bit0 : ~n.bit0) &
+                ((count & 2) ? n.bit1 : ~n.bit1) &
+                ((count & 4) ? n.bit2 : ~n.bit2) &
+                ((count & 8) ? n.bit3 : ~n.bit3);
+        }
+    }
+
+    return result;
+}
+
+LifeGrid::LifeGrid()
+{
+}
+
+LifeGrid::~LifeGrid()
+{
+    Release();
+}
+
+void LifeGrid::Release()
+{
+    free(m_current);
+    free(m_next);
+    free(m_emptyRow);
+
+    m_current = NULL;
+    m_next = NULL;
+    m_emptyRow = NULL;
+    m_planeCapacity = 0;
+}
+
+bool LifeGrid::Allocate(unsigned int width, unsigned int height)
+{
+    Release();
+
+    m_width = width;
+    m_height = height;
+    m_rowWords = (width + 63) / 64;
+    m_planeWords = (size_t)m_rowWords * height;
+    m_tailMask = (width % 64) ? (1ull << (width % 64)) - 1 : ~0ull;
+
+    m_survive = (1u << 2) | (1u << 3);
+    m_birth = 1u << 3;
+    m_states = 2;
+    m_counterPlanes = 0;
+
+    m_emptyRow = (Word*)(calloc(m_rowWords, sizeof(Word)));
+    if (!m_emptyRow || !ReservePlanes(1))
+    {
+        Release();
+        return false;
+    }
+
+    return true;
+}
+
+bool LifeGrid::ReservePlanes(unsigned int planes)
+{
+    if (planes <= m_planeCapacity)
+    {
+        return true;
+    }
+
+    if ((unsigned long long)m_planeWords * planes * sizeof(Word) > SIZE_MAX)
+    {
+        return false;
+    }
+
+    Word* current = (Word*)(calloc(m_planeWords * planes, sizeof(Word)));
+    Word* next = (Word*)(calloc(m_planeWords * planes, sizeof(Word)));
+    if (!current || !next)
+    {
+        free(current);
+        free(next);
+        return false;
+    }
+
+    if (m_current)
+    {
+        memcpy(current, m_current, m_planeWords * (m_counterPlanes + 1) * sizeof(Word));
+    }
+
+    free(m_current);
+    free(m_next);
+    m_current = current;
+    m_next = next;
+    m_planeCapacity = planes;
+
+    return true;
+}
+
+bool LifeGrid::SetRule(unsigned int survive, unsigned int birth, unsigned int states)
+{
+    // Counters run from 1 to states - 2.
+    unsigned int counterPlanes = 0;
+    while (states > 2 && (1u << counterPlanes) <= states - 2)
+    {
+        counterPlanes++;
+    }
+
+    if (counterPlanes > MaxCounterPlanes || !ReservePlanes(counterPlanes + 1))
+    {
+        return false;
+    }
+
+    // Cells past the new last dying state die. Counters too big for the new
+    // planes are among them, so the planes dropped end up clear.
+    Word* counters = m_current + m_planeWords;
+    for (size_t i = 0; i < m_planeWords; i++)
+    {
+        Word dying = 0;
+        for (unsigned int k = 0; k < m_counterPlanes; k++)
+        {
+            dying |= counters[k * m_planeWords + i];
+        }
+
+        for (; dying; dying &= dying - 1)
+        {
+            Word bit = dying & (~dying + 1);
+            unsigned int counter = 0;
+            for (unsigned int k = 0; k < m_counterPlanes; k++)
+            {
+                if (counters[k * m_planeWords + i] & bit) counter |= 1u << k;
+            }
+
+            if (counter + 1 >= states)
+            {
+                for (unsigned int k = 0; k < m_counterPlanes; k++)
+                {
+                    counters[k * m_planeWords + i] &= ~bit;
+                }
+            }
+        }
+    }
+
+    // Planes coming back into use may still hold an old generation.
+    if (counterPlanes > m_counterPlanes)
+    {
+        memset(
+            counters + m_counterPlanes * m_planeWords,
+            0,
+            (counterPlanes - m_counterPlanes) * m_planeWords * sizeof(Word)
+        );
+    }
+
+    m_survive = survive;
+    m_birth = birth;
+    m_states = states;
+    m_counterPlanes = counterPlanes;
+
+    return true;
+}
+
+void LifeGrid::Pack(const unsigned char* states)
+{
+    memset(m_current, 0, m_planeWords * (m_counterPlanes + 1) * sizeof(Word));
+
+    for (unsigned int y = 0; y < m_height; y++)
+    {
+        const unsigned char* row = states + (size_t)y * m_width;
+
+        for (unsigned int x = 0; x < m_width; x++)
+        {
+            size_t index = (size_t)y * m_rowWords + x / 64;
+            Word bit = 1ull << (x % 64);
+            unsigned int state = row[x];
+
+            if (state == 1)
+            {
+                m_current[index] |= bit;
+            }
+            else if (state >= 2 && state < m_states)
+            {
+                for (unsigned int k = 0; k < m_counterPlanes; k++)
+                {
+                    if (((state - 1) >> k) & 1) m_current[(k + 1) * m_planeWords + index] |= bit;
+                }
+            }
+        }
+    }
+}
+
+void LifeGrid::Unpack(unsigned char* states) const
+{
+    // Read the planes through one pointer so that a Step finishing on
+    // another thread cannot mix two generations into one view.
+    const Word* planes = m_current;
+
+    for (unsigned int y = 0; y < m_height; y++)
+    {
+        unsigned char* row = states + (size_t)y * m_width;
+
+        for (unsigned int w = 0; w < m_rowWords; w++)
+        {
+            size_t index = (size_t)y * m_rowWords + w;
+            Word live = planes[index];
+            Word counters[MaxCounterPlanes];
+            for (unsigned int k = 0; k < m_counterPlanes; k++)
+            {
+                counters[k] = planes[(k + 1) * m_planeWords + index];
+            }
+
+            unsigned int first = w * 64;
+            unsigned int count = (w + 1 < m_rowWords) ? 64 : m_width - first;
+            for (unsigned int i = 0; i < count; i++)
+            {
+                unsigned int counter = 0;
+                for (unsigned int k = 0; k < m_counterPlanes; k++)
+                {
+                    counter |= (unsigned int)((counters[k] >> i) & 1) << k;
+                }
+
+                row[first + i] = static_cast<unsigned char>(((live >> i) & 1) ? 1 : counter ? counter + 1 : 0);
+            }
+        }
+    }
+}
+
+void LifeGrid::Step(unsigned char* ages)
+{
+    if (ages)
+    {
+        StepRows<true>(ages);
+    }
+    else
+    {
+        StepRows<false>(NULL);
+    }
+
+    Word* swap = m_current;
+    m_current = m_next;
+    m_next = swap;
+}
+
+template<bool TrackAges>
+void LifeGrid::StepRows(unsigned char* ages)
+{
+    // A dying cell whose counter reaches this wraps round to dead.
+    const unsigned int lastCounter = m_states - 1;
+
+    for (unsigned int y = 0; y < m_height; y++)
+    {
+        const Word* row = m_current + (size_t)y * m_rowWords;
+        const Word* above = (y > 0) ? row - m_rowWords : m_emptyRow;
+        const Word* below = (y + 1 < m_height) ? row + m_rowWords : m_emptyRow;
+
+        for (unsigned int w = 0; w < m_rowWords; w++)
+        {
+            size_t index = (size_t)y * m_rowWords + w;
+            bool last = (w + 1 == m_rowWords);
+
+            // Shift each row of neighbours into line with the cells they
+            // border, carrying the edge bits across from the next words.
+            Word a = above[w], b = row[w], c = below[w];
+            Word aWest = (a << 1) | (w > 0 ? above[w - 1] >> 63 : 0);
+            Word aEast = (a >> 1) | (!last ? above[w + 1] << 63 : 0);
+            Word bWest = (b << 1) | (w > 0 ? row[w - 1] >> 63 : 0);
+            Word bEast = (b >> 1) | (!last ? row[w + 1] << 63 : 0);
+            Word cWest = (c << 1) | (w > 0 ? below[w - 1] >> 63 : 0);
+            Word cEast = (c >> 1) | (!last ? below[w + 1] << 63 : 0);
+
+            // Full adders over the rows above and below and a half adder
+            // over the two side neighbours give three 2-bit sums, which
+            // then add up to the 4-bit count.
+            Word aOnes = aWest ^ a ^ aEast;
+            Word aTwos = (aWest & a) | (aEast & (aWest ^ a));
+            Word cOnes = cWest ^ c ^ cEast;
+            Word cTwos = (cWest & c) | (cEast & (cWest ^ c));
+            Word bOnes = bWest ^ bEast;
+            Word bTwos = bWest & bEast;
+
+            NeighborCount n;
+            n.bit0 = aOnes ^ cOnes ^ bOnes;
+            Word onesCarry = (aOnes & cOnes) | (bOnes & (aOnes ^ cOnes));
+
+            Word twos = aTwos ^ cTwos ^ bTwos;
+            Word twosCarry = (aTwos & cTwos) | (bTwos & (aTwos ^ cTwos));
+            n.bit1 = twos ^ onesCarry;
+            Word fours = twos & onesCarry;
+            n.bit2 = twosCarry ^ fours;
+            n.bit3 = twosCarry & fours;
+
+            Word counters[MaxCounterPlanes];
+            Word dying = 0;
+            for (unsigned int k = 0; k < m_counterPlanes; k++)
+            {
+                counters[k] = m_current[(k + 1) * m_planeWords + index];
+                dying |= counters[k];
+            }
+
+            Word survives = CountIn(m_survive, n);
+            Word live = (b & survives) | (~b & ~dying & CountIn(m_birth, n));
+            if (last)
+            {
+                live &= m_tailMask;
+            }
+            m_next[index] = live;
+
+            if (m_counterPlanes > 0)
+            {
+                // Dying cells count up by one and those that reach the last
+                // counter wrap to dead; live cells that do not survive start
+                // dying with a counter of 1.
+                Word carry = dying;
+                Word wrapped = ~0ull;
+                for (unsigned int k = 0; k < m_counterPlanes; k++)
+                {
+                    Word counter = counters[k] ^ carry;
+                    carry &= counters[k];
+                    counters[k] = counter;
+                    wrapped &= ((lastCounter >> k) & 1) ? counter : ~counter;
+                }
+
+                Word leaving = b & ~survives;
+                for (unsigned int k = 0; k < m_counterPlanes; k++)
+                {
+                    Word counter = counters[k] & ~wrapped;
+                    m_next[(k + 1) * m_planeWords + index] = (k == 0) ? (counter | leaving) : counter;
+                }
+            }
+
+            if (TrackAges)
+            {
+                unsigned char* cellAges = ages + (size_t)y * m_width + w * 64;
+                unsigned int count = last ? m_width - w * 64 : 64;
+                for (unsigned int i = 0; i < count; i++)
+                {
+                    unsigned char age = cellAges[i];
+                    cellAges[i] = ((live >> i) & 1) ? static_cast<unsigned char>(age + (age < 255)) : 0;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+
+// A board stored as bit-planes, 64 cells to a word.
+//
+// The first plane holds the live cells. Cells in the dying states of a
+// Generations rule carry a counter, state - 1, spread over as many further
+// planes as the rule needs; dead and live cells have a counter of 0.
+// A generation is computed a word at a time: neighbour counts come out of
+// bit-sliced adders, and survival, birth and the dying countdown are applied
+// with word-wide masks, so a rule with C states only adds about log2(C)
+// operations per 64 cells on top of Life. Cells beyond the edges are dead.
+//
+// The renderer and the exporter read one byte per cell through Unpack. Like
+// Pacer, the class has no platform dependencies.
+class LifeGrid
+{
+public:
+    LifeGrid();
+    ~LifeGrid();
+
+    // Size the board for plain Life and clear it. Returns false when out of
+    // memory.
+    bool Allocate(unsigned int width, unsigned int height);
+
+    // Switch to the rule with the given survive and birth neighbour masks
+    // and state count. Cells in states the new rule does not have die.
+    // Returns false, keeping the old rule, when there is no memory for the
+    // extra counter planes.
+    bool SetRule(unsigned int survive, unsigned int birth, unsigned int states);
+
+    // Load the board from one state byte per cell, row by row. States the
+    // rule does not have load as dead.
+    void Pack(const unsigned char* states);
+
+    // Write the board out as one state byte per cell, row by row.
+    void Unpack(unsigned char* states) const;
+
+    // Advance by one generation. When `ages` is not NULL it holds one
+    // saturating age per cell, row by row, and is updated in the same pass.
+    void Step(unsigned char* ages);
+
+private:
+    typedef unsigned long long Word;
+
+    // The age update is compiled out of the TrackAges == false
+    // instantiation, so the plain rule update pays nothing for it.
+    template<bool TrackAges>
+    void StepRows(unsigned char* ages);
+
+    // Reallocate both plane buffers to hold `planes` planes, keeping the
+    // current board.
+    bool ReservePlanes(unsigned int planes);
+
+    void Release();
+
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+
+    // Words per row; the bits past the right edge in the last word of each
+    // row are always 0.
+    unsigned int m_rowWords = 0;
+    size_t m_planeWords = 0;
+    Word m_tailMask = 0;
+
+    unsigned int m_survive = 0;
+    unsigned int m_birth = 0;
+    unsigned int m_states = 2;
+
+    // Planes after the live one, and how many each buffer has room for.
+    unsigned int m_counterPlanes = 0;
+    unsigned int m_planeCapacity = 0;
+
+    // This generation and the one being computed, each a live plane
+    // followed by the counter planes.
+    Word* m_current = NULL;
+    Word* m_next = NULL;
+
+    // A row of dead cells standing in for the rows above and below the
+    // board.
+    Word* m_emptyRow = NULL;
+};
@@ -0,0 +1,173 @@
+#include <windows.h>
+#include <stdio.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "LifeRule.h"
+
+HRESULT InitializeLifeRule(LifeRule* pRule, UINT survive, UINT birth, UINT states)
+{
+    if (states < 2 || states > LIFE_RULE_MAX_STATES || survive > 0x1FF || birth > 0x1FF)
+    {
+        return E_INVALIDARG;
+    }
+
+    pRule->survive = survive;
+    pRule->birth = birth;
+    pRule->states = states;
+
+    return S_OK;
+}
+
+// Parse a run of neighbour counts into a bit mask, stopping at '/' or the
+// end of the string.
+static HRESULT ParseNeighborMask(LPCWSTR* pText, UINT* pMask)
+{
+    LPCWSTR text = *pText;
+    UINT mask = 0;
+
+    for (; *text && *text != L'/'; text++)
+    {
+        if (*text < L'0' || *text > L'8')
+        {
+            return E_INVALIDARG;
+        }
+        mask |= 1u << (*text - L'0');
+    }
+
+    *pText = text;
+    *pMask = mask;
+
+    return S_OK;
+}
+
+static HRESULT ParseStateCount(LPCWSTR* pText, UINT* pStates)
+{
+    LPCWSTR text = *pText;
+    UINT states = 0;
+
+    if (!iswdigit(*text))
+    {
+        return E_INVALIDARG;
+    }
+
+    for (; iswdigit(*text); text++)
+    {
+        states = states * 10 + (*text - L'0');
+        if (states > LIFE_RULE_MAX_STATES)
+        {
+            return E_INVALIDARG;
+        }
+    }
+
+    if (*text && *text != L'/')
+    {
+        return E_INVALIDARG;
+    }
+
+    *pText = text;
+    *pStates = states;
+
+    return S_OK;
+}
+
+HRESULT ParseLifeRule(LPCWSTR text, LifeRule* pRule)
+{
+    HRESULT hr = S_OK;
+
+    UINT survive = 0;
+    UINT birth = 0;
+    UINT states = 2;
+
+    if (!text || !*text)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (iswalpha(*text))
+    {
+        // B/S/C form: each field is tagged, in any order.
+        bool seen[3] = { false, false, false };
+
+        while (SUCCEEDED(hr) && *text)
+        {
+            WCHAR tag = towupper(*text++);
+            int field = (tag == L'S') ? 0 : (tag == L'B') ? 1 : (tag == L'C' || tag == L'G') ? 2 : -1;
+
+            if (field < 0 || seen[field])
+            {
+                return E_INVALIDARG;
+            }
+            seen[field] = true;
+
+            if (field == 0) hr = ParseNeighborMask(&text, &survive);
+            else if (field == 1) hr = ParseNeighborMask(&text, &birth);
+            else hr = ParseStateCount(&text, &states);
+
+            if (SUCCEEDED(hr) && *text == L'/')
+            {
+                text++;
+                hr = *text ? S_OK : E_INVALIDARG;
+            }
+        }
+
+        if (SUCCEEDED(hr) && (!seen[0] || !seen[1]))
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+    else
+    {
+        // S/B/C form: survive and birth are required, the state count is
+        // optional.
+        hr = ParseNeighborMask(&text, &survive);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = (*text++ == L'/') ? ParseNeighborMask(&text, &birth) : E_INVALIDARG;
+        }
+
+        if (SUCCEEDED(hr) && *text == L'/')
+        {
+            text++;
+            hr = ParseStateCount(&text, &states);
+        }
+
+        if (SUCCEEDED(hr) && *text)
+        {
+            hr = E_INVALIDARG;
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = InitializeLifeRule(pRule, survive, birth, states);
+    }
+
+    return hr;
+}
+
+void FormatLifeRule(const LifeRule* pRule, char* text, size_t size)
+{
+    char survive[10];
+    char birth[10];
+    int survived = 0;
+    int born = 0;
+
+    for (int neighbors = 0; neighbors < 9; neighbors++)
+    {
+        if ((pRule->survive >> neighbors) & 1) survive[survived++] = static_cast<char>('0' + neighbors);
+        if ((pRule->birth >> neighbors) & 1) birth[born++] = static_cast<char>('0' + neighbors);
+    }
+    survive[survived] = '\0';
+    birth[born] = '\0';
+
+    if (pRule->states > 2)
+    {
+        snprintf(text, size, "%s/%s/%u", survive, birth, pRule->states);
+    }
+    else
+    {
+        snprintf(text, size, "%s/%s", survive, birth);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <windows.h>
+
+#define LIFE_RULE_MAX_STATES 256
+
+// A Life-like or Generations rule.
+//
+// State 0 is dead and state 1 is alive; only live cells count as
+// neighbours. A live cell that does not survive moves to state 2 and then
+// steps through the remaining "dying" states before it is dead again, so a
+// rule with two states is plain Life.
+struct LifeRule
+{
+    // Bit n is set when a live cell with n live neighbours survives.
+    UINT survive;
+
+    // Bit n is set when a dead cell with n live neighbours comes alive.
+    UINT birth;
+
+    // Number of states, counting dead and alive.
+    UINT states;
+};
+
+// Fill in a rule from its survive and birth masks.
+HRESULT InitializeLifeRule(LifeRule* pRule, UINT survive, UINT birth, UINT states);
+
+// Parse a rule in S/B/C notation ("23/3" for Life, "/2/3" for Brian's Brain,
+// "345/2/4" for Star Wars), or the equivalent B/S/C form ("B3/S23",
+// "B2/S/C3"). The state count defaults to 2.
+HRESULT ParseLifeRule(LPCWSTR text, LifeRule* pRule);
+
+// Write a rule back out in S/B/C notation, leaving off the state count for
+// two-state rules.
+void FormatLifeRule(const LifeRule* pRule, char* text, size_t size);
@@ -0,0 +1,97 @@
+#include "Pacer.h"
+
+// Redraws per second the batch size aims for.
+static const unsigned int FrameRate = 60;
+static const long long FrameInterval = 1000000 / FrameRate;
+
+// Largest batch, to bound the time to react to a stop request while the
+// cost estimate is still settling.
+static const unsigned int MaxBatch = 1 << 16;
+
+// How far the schedule may fall behind before the missed time is dropped.
+static const long long MaxLag = 250000;
+
+// Weight of the newest measurement in the smoothed generation cost.
+static const double CostSmoothing = 0.25;
+
+Pacer::Pacer() :
+    m_target(0),
+    m_generationCost(0.0),
+    m_nextDue(0)
+{
+}
+
+void Pacer::SetTarget(unsigned int generationsPerSecond)
+{
+    m_target = generationsPerSecond;
+}
+
+void Pacer::Start(long long now)
+{
+    m_nextDue = now;
+}
+
+unsigned int Pacer::BatchSize() const
+{
+    // Without a measurement yet, take a single step to get one.
+    if (m_generationCost <= 0.0)
+    {
+        return 1;
+    }
+
+    double batch = FrameInterval / m_generationCost;
+
+    if (m_target != 0)
+    {
+        // Only batch up the generations that fall due within one redraw
+        // interval; below the frame rate that is one per wake-up.
+        double due = (double)m_target / FrameRate;
+        if (due < batch)
+        {
+            batch = due;
+        }
+    }
+
+    if (batch < 1.0)
+    {
+        return 1;
+    }
+    if (batch > MaxBatch)
+    {
+        return MaxBatch;
+    }
+
+    return static_cast<unsigned int>(batch);
+}
+
+long long Pacer::OnBatchComplete(unsigned int generations, long long elapsed, long long now)
+{
+    if (generations > 0)
+    {
+        double cost = (double)elapsed / generations;
+
+        if (m_generationCost <= 0.0)
+        {
+            m_generationCost = cost;
+        }
+        else
+        {
+            m_generationCost += CostSmoothing * (cost - m_generationCost);
+        }
+    }
+
+    if (m_target == 0)
+    {
+        m_nextDue = now;
+        return 0;
+    }
+
+    m_nextDue += (long long)generations * 1000000 / m_target;
+
+    if (now - m_nextDue > MaxLag)
+    {
+        m_nextDue = now;
+    }
+
+    return m_nextDue > now ? m_nextDue - now : 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Paces the simulation thread to a target number of generations per second.
+//
+// The thread wakes up, computes BatchSize() generations, reports how long
+// they took to OnBatchComplete and sleeps for as long as it says. Batches
+// are sized from the measured cost of a generation so that one batch never
+// takes much longer than a redraw interval: slow boards step once per
+// wake-up, fast boards run many generations between redraws. Times are in
+// microseconds on any monotonic clock, so the class has no platform
+// dependencies.
+class Pacer
+{
+public:
+    Pacer();
+
+    // Generations per second to aim for; 0 runs as fast as possible.
+    void SetTarget(unsigned int generationsPerSecond);
+
+    unsigned int Target() const { return m_target; }
+
+    // Start a new run at `now`, forgetting any schedule from the last one.
+    // The measured generation cost is kept.
+    void Start(long long now);
+
+    // Generations to compute on this wake-up.
+    unsigned int BatchSize() const;
+
+    // Record that `generations` took `elapsed` to compute, finishing at
+    // `now`. Returns how long to wait before the next batch.
+    long long OnBatchComplete(unsigned int generations, long long elapsed, long long now);
+
+    // Smoothed cost of one generation, or 0 before the first batch.
+    double GenerationCost() const { return m_generationCost; }
+
+private:
+    unsigned int m_target;
+
+    double m_generationCost;
+
+    // When the next batch is due. Falls behind `now` when the board cannot
+    // keep up; the debt is capped so a slow patch does not cause a burst.
+    long long m_nextDue;
+};
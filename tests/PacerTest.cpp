@@ -0,0 +1,128 @@
+// Standalone checks for Pacer, driven by a fake clock. Not part of
+// KabLife.vcxproj; build and run from the repository root with
+//
+//     cl /EHsc /W3 /Isrc tests\PacerTest.cpp src\Pacer.cpp && PacerTest
+//     g++ -Wall -Isrc tests/PacerTest.cpp src/Pacer.cpp -o PacerTest && ./PacerTest
+//
+// Exits with a non-zero status if any check fails.
+
+#include <math.h>
+#include <stdio.h>
+
+#include "Pacer.h"
+
+static int failures = 0;
+
+struct RunResult
+{
+    double generationsPerSecond;
+    double wakesPerSecond;
+};
+
+// Run the simulation loop for `duration` microseconds of fake time against a
+// board whose generations each cost `generationCost` microseconds.
+static RunResult Simulate(Pacer& pacer, double generationCost, long long duration)
+{
+    long long now = 0;
+    unsigned long long generations = 0;
+    unsigned long long wakes = 0;
+
+    pacer.Start(now);
+
+    while (now < duration)
+    {
+        unsigned int batch = pacer.BatchSize();
+        long long elapsed = static_cast<long long>(batch * generationCost);
+
+        now += elapsed;
+        generations += batch;
+        wakes++;
+
+        now += pacer.OnBatchComplete(batch, elapsed, now);
+    }
+
+    RunResult result;
+    result.generationsPerSecond = generations / (now / 1e6);
+    result.wakesPerSecond = wakes / (now / 1e6);
+
+    return result;
+}
+
+static void CheckNear(const char* name, double actual, double expected, double tolerance)
+{
+    bool passed = fabs(actual - expected) <= expected * tolerance;
+
+    printf("%s %s: %.1f (expected %.1f)\n", passed ? "PASS" : "FAIL", name, actual, expected);
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+static void CheckAtMost(const char* name, double actual, double limit)
+{
+    bool passed = actual <= limit;
+
+    printf("%s %s: %.1f (limit %.1f)\n", passed ? "PASS" : "FAIL", name, actual, limit);
+    if (!passed)
+    {
+        failures++;
+    }
+}
+
+int main()
+{
+    const long long duration = 10000000;
+
+    // A fixed target below the frame rate steps once per wake-up.
+    {
+        Pacer pacer;
+        pacer.SetTarget(13);
+        RunResult result = Simulate(pacer, 50.0, duration);
+        CheckNear("fixed 13 gen/s rate", result.generationsPerSecond, 13.0, 0.02);
+        CheckNear("fixed 13 gen/s wake-ups", result.wakesPerSecond, 13.0, 0.02);
+    }
+
+    // A fixed target above the frame rate batches up to about 60 wake-ups.
+    {
+        Pacer pacer;
+        pacer.SetTarget(1000);
+        RunResult result = Simulate(pacer, 50.0, duration);
+        CheckNear("fixed 1000 gen/s rate", result.generationsPerSecond, 1000.0, 0.02);
+        CheckAtMost("fixed 1000 gen/s wake-ups", result.wakesPerSecond, 70.0);
+    }
+
+    // A board too slow for the target runs flat out, in batches that still
+    // fit a frame, without piling up debt.
+    {
+        Pacer pacer;
+        pacer.SetTarget(1000);
+        RunResult result = Simulate(pacer, 5000.0, duration);
+        CheckNear("slow board rate", result.generationsPerSecond, 200.0, 0.02);
+        CheckAtMost("slow board wake-ups", result.wakesPerSecond, 70.0);
+    }
+
+    // Max speed never sleeps and still only wakes about once per frame.
+    {
+        Pacer pacer;
+        pacer.SetTarget(0);
+        RunResult result = Simulate(pacer, 50.0, duration);
+        CheckNear("max speed rate", result.generationsPerSecond, 20000.0, 0.02);
+        CheckNear("max speed wake-ups", result.wakesPerSecond, 60.0, 0.1);
+    }
+
+    // Switching target mid-run keeps the measured cost and paces to the new
+    // rate straight away.
+    {
+        Pacer pacer;
+        pacer.SetTarget(0);
+        Simulate(pacer, 50.0, duration / 10);
+        pacer.SetTarget(60);
+        RunResult result = Simulate(pacer, 50.0, duration);
+        CheckNear("switched to 60 gen/s rate", result.generationsPerSecond, 60.0, 0.02);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "All pacer checks passed");
+
+    return failures ? 1 : 0;
+}